@@ -0,0 +1,53 @@
+// bench.cc -- emission and loading of large sections (build with and without -DRSN_USE_SECT_CHUNKS to compare section storage strategies)
+
+# include <cstdio>  // printf, fflush
+# include <cstdlib> // atoi, exit
+# include <chrono>
+
+# include <sys/resource.h>
+# include <sys/wait.h>
+# include <unistd.h>
+
+# include "jit-asm.hh"
+
+int main(int argc, char *argv[]) {
+   using clock = std::chrono::steady_clock;
+   static constexpr auto secs = [](clock::duration dur)RSN_INLINE{ return std::chrono::duration<double>(dur).count(); };
+   static constexpr auto max_rss = []()RSN_INLINE{ struct rusage ru; ::getrusage(RUSAGE_SELF, &ru); return ru.ru_maxrss; }; // in KiB
+
+# if RSN_USE_SECT_CHUNKS
+   std::printf("section storage: chunks\n");
+# else
+   std::printf("section storage: realloc\n");
+# endif
+   std::fflush(stdout);
+   for (int size_mib: {1, 4, 16, 64, 128}) {
+      if (argc > 1 && size_mib != std::atoi(argv[1])) continue;
+      // each size in a fresh process, so that the peak RSS during emission is not affected by preceding runs nor by loading
+      if (auto pid = ::fork(); pid) { if (RSN_LIKELY(pid > 0)) ::waitpid(pid, {}, 0); continue; }
+      auto base_rss = max_rss(), emit_rss = 0L;
+      int emit_size = 0, load_size = 0;
+      double emit_time = 1e9, load_time = 1e9;
+      for (int rep = 0; rep < 5; ++rep) {
+         rsn::objcode oc;
+         auto start = clock::now();
+         {  auto ts = oc.text();
+            auto l0 = ts.label();
+            for (int _ = (size_mib << 20) / 16; _; --_) if (RSN_LIKELY(_ % 64)) ts .reserve(14) // exact amounts reserved for each piece
+               .sw(0x48B8).q(0x0123456789ABCDEF) .sw(0x4801).b(0xC3) .b(0x90); // movabsq $0x0123456789ABCDEF, %rax; addq %rax, %rbx; nop
+            else ts .reserve(16)
+               .sw(0x48B8).q(0x0123456789ABCDEF) .b(0xE9).rl(l0) .b(0x90);     // movabsq $0x0123456789ABCDEF, %rax; jmp.d32 l0; nop
+         }
+         auto mid = clock::now();
+         if (RSN_UNLIKELY(!rep)) emit_rss = max_rss() - base_rss, emit_size = oc.size();
+         auto segm = oc.load();
+         auto end = clock::now();
+         load_size = segm.size();
+         emit_time = std::min(emit_time, secs(mid - start)), load_time = std::min(load_time, secs(end - mid));
+      }
+      std::printf("%4d MiB pieces (%7.2f MiB emitted): emit %8.2f MiB/s, load %8.2f MiB/s, peak RSS while emitting +%7ld KiB (%.2fx)\n",
+         size_mib, emit_size / 1048576., emit_size / 1048576. / emit_time, load_size / 1048576. / load_time, emit_rss, emit_rss * 1024. / emit_size);
+      std::fflush(stdout), std::exit(0);
+   }
+   return 0;
+}
@@ -19,18 +19,22 @@
 
 # include <sys/mman.h>
 
+# if __x86_64__ && __SIZEOF_POINTER__ == __SIZEOF_LONG_LONG__
+   # include <cpuid.h> // __get_cpuid, __cpuid_count
+# endif
+
 int rsn::objcode::size() const noexcept {
    int pc = 0;
    bool has_rodata = false;
    for (const auto &sect: _sects) if (RSN_UNLIKELY(sect.is_rodata)) has_rodata = true; else {
-      if (RSN_UNLIKELY((unsigned)(pc = pc + sect.align - 1 & -sect.align) + (int)(sect.pc - sect.base) > 1 << max_segm_size_p2)) return -1;
-      pc += (int)(sect.pc - sect.base);
+      if (RSN_UNLIKELY((unsigned)(pc = pc + sect.align - 1 & -sect.align) + sect.size() > 1 << max_segm_size_p2)) return -1;
+      pc += sect.size();
    }
    if (RSN_LIKELY(!has_rodata)) return pc;
    pc = pc + (1 << cacheline_size_p2) - 1 & -(1 << cacheline_size_p2);
    for (const auto &sect: _sects) if (!RSN_UNLIKELY(sect.is_rodata)); else {
-      if (RSN_UNLIKELY((unsigned)(pc = pc + sect.align - 1 & -sect.align) + (int)(sect.pc - sect.base) > 1 << max_segm_size_p2)) return -1;
-      pc += (int)(sect.pc - sect.base);
+      if (RSN_UNLIKELY((unsigned)(pc = pc + sect.align - 1 & -sect.align) + sect.size() > 1 << max_segm_size_p2)) return -1;
+      pc += sect.size();
    }
    return pc;
 }
@@ -41,21 +45,29 @@ void rsn::objcode::load(unsigned char *RSN_RESTRICT base) const {
    auto using_vla = (int)_sects.size() <= (1 << 16) / sizeof(unsigned char *) /*not exceeding 64 KiB*/; // VLAs in C++ (and zero-length VLAs) is a GCC extension
    unsigned char *_vla[RSN_LIKELY(using_vla) ? _sects.size() : 0], **const load_base = RSN_LIKELY(using_vla) ? _vla : new unsigned char *[_sects.size()];
    // transfer contents of sections to target load address
+   static constexpr auto load_sect = [](unsigned char *RSN_RESTRICT base, const _sect &sect)RSN_INLINE {
+   # if RSN_USE_SECT_CHUNKS
+      auto pc = base; // gather the chunks
+      for (auto chunk: sect.chunks) _memcpy(pc, chunk.base, chunk.size), pc += chunk.size;
+      _memcpy(pc, sect.base, sect.pc - sect.base);
+      return base;
+   # else
+      return static_cast<unsigned char *>(_memcpy(base, sect.base, sect.pc - sect.base));
+   # endif
+   };
    [&]()RSN_INLINE {
       int pc = 0;
       bool has_rodata = false;
       {  auto _load_base = load_base;
          for (const auto &sect: _sects) if (RSN_UNLIKELY(sect.is_rodata)) ++_load_base, has_rodata = true; else {
-            int size = sect.pc - sect.base;
-            *_load_base++ = static_cast<unsigned char *>(_memcpy(base + (unsigned)(pc = pc + sect.align - 1 & -sect.align), sect.base, size)), pc += size;
+            *_load_base++ = load_sect(base + (unsigned)(pc = pc + sect.align - 1 & -sect.align), sect), pc += sect.size();
          }
       }
       if (RSN_LIKELY(!has_rodata)) return;
       pc = pc + (1 << cacheline_size_p2) - 1 & -(1 << cacheline_size_p2);
       {  auto _load_base = load_base;
          for (const auto &sect: _sects) if (!RSN_UNLIKELY(sect.is_rodata)) ++_load_base; else {
-            int size = sect.pc - sect.base;
-            *_load_base++ = static_cast<unsigned char *>(_memcpy(base + (unsigned)(pc = pc + sect.align - 1 & -sect.align), sect.base, size)), pc += size;
+            *_load_base++ = load_sect(base + (unsigned)(pc = pc + sect.align - 1 & -sect.align), sect), pc += sect.size();
          }
       }
    }();
@@ -91,6 +103,77 @@ void rsn::objcode::load(unsigned char *RSN_RESTRICT base) const {
    RSN_BARRIER();
 }
 
+# if __x86_64__ && __SIZEOF_POINTER__ == __SIZEOF_LONG_LONG__
+
+// shared resolvers for lazy stubs: on entry, %r11 points to the descriptor {slot, resolver, compile, data} and the stack is as at the call site
+// (argument registers, including the full vector state, are preserved around compile, which may clobber them, e.g. via AVX-enabled libc routines)
+extern "C" __attribute__((__visibility__("hidden"))) void rsn_objcode_lazy_resolve_xsave(), rsn_objcode_lazy_resolve_fxsave();
+extern "C" __attribute__((__visibility__("hidden"))) long rsn_objcode_lazy_xsave_size; // for XCR0-enabled state components (including the XSAVE header)
+__attribute__((__used__)) long rsn_objcode_lazy_xsave_size; // referenced only from the asm below (and hence otherwise dropped under LTO)
+__asm__ (R"asm(
+   .pushsection .text
+   .macro rsn_objcode_lazy_resolve name, size, save, restore
+   .p2align 4
+   .globl \name
+   .hidden \name
+   .type \name, @function
+\name:
+   .cfi_startproc
+   pushq %rbp
+   .cfi_def_cfa_offset 16
+   .cfi_offset %rbp, -16
+   movq %rsp, %rbp
+   .cfi_def_cfa_register %rbp
+   pushq %rdi; pushq %rsi; pushq %rdx; pushq %rcx; pushq %r8; pushq %r9; pushq %rax; pushq %r11
+   subq \size, %rsp
+   andq $-64, %rsp
+   movq $0, 512(%rsp); movq $0, 520(%rsp); movq $0, 528(%rsp); movq $0, 536(%rsp) # XSAVE header
+   movq $0, 544(%rsp); movq $0, 552(%rsp); movq $0, 560(%rsp); movq $0, 568(%rsp)
+   movl $0xEE, %eax; xorl %edx, %edx # state components: SSE, AVX, MPX bound registers, AVX-512 (as for glibc's _dl_runtime_resolve_xsave)
+   \save (%rsp)
+   movq 24(%r11), %rdi
+   call *16(%r11)
+   movq -64(%rbp), %r11
+   movq %rax, (%r11)
+   movl $0xEE, %eax; xorl %edx, %edx
+   \restore (%rsp)
+   leaq -64(%rbp), %rsp
+   popq %r11; popq %rax; popq %r9; popq %r8; popq %rcx; popq %rdx; popq %rsi; popq %rdi
+   popq %rbp
+   .cfi_def_cfa %rsp, 8
+   .cfi_restore %rbp
+   jmpq *(%r11)
+   .cfi_endproc
+   .size \name, .-\name
+   .endm
+   rsn_objcode_lazy_resolve rsn_objcode_lazy_resolve_xsave,  rsn_objcode_lazy_xsave_size(%rip), xsave,  xrstor
+   rsn_objcode_lazy_resolve rsn_objcode_lazy_resolve_fxsave, $576,                            fxsave, fxrstor
+   .purgem rsn_objcode_lazy_resolve
+   .popsection
+)asm");
+
+struct rsn::objcode::label rsn::objcode::lazy(void *(*compile)(void *), void *data) & {
+   // placed along with rodata (the whole segment is executable) so as to never become the entry point and to keep the slot off hot text cache lines
+   if (RSN_UNLIKELY(_lazy_sect < 0)) _lazy_sect = rodata().id.sn;
+   struct sect sect{*this, decltype(sect::id){_lazy_sect}};
+   static const auto resolve = []()RSN_NOINLINE{
+      unsigned eax, ebx, ecx, edx;
+      if (RSN_UNLIKELY(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))) return rsn_objcode_lazy_resolve_fxsave;
+      __cpuid_count(0xD, 0, eax, ebx, ecx, edx); rsn_objcode_lazy_xsave_size = ebx;
+      return rsn_objcode_lazy_resolve_xsave;
+   }();
+   auto slot = label(), stub = label();
+   sect .reserve(7 + 4 * sizeof(x86quad) + 7 + 4)
+      .align(8).label(slot)
+      .q(stub) .q(resolve) .q(compile) .q(data) // descriptor {slot, resolver, compile, data}
+      .label(stub)
+      .b(0x4C).sw(0x8D1D).rl(slot) // leaq slot(%rip), %r11
+      .sl(0x41FF6308);             // jmpq *8(%r11)
+   return slot;
+}
+
+# endif // # if __x86_64__ && __SIZEOF_POINTER__ == __SIZEOF_LONG_LONG__
+
 namespace rsn {
    constexpr auto
       min_size_p2    = 1 + 6      /*128 B   - two cache lines     */,
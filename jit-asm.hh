@@ -16,7 +16,7 @@
 
 # include <new>       // bad_alloc
 # include <cassert>
-# include <cstdlib>   // realloc, free
+# include <cstdlib>   // realloc, malloc, free
 # include <cstring>   // memcpy
 # include <limits>
 # include <utility>   // swap
@@ -25,12 +25,22 @@
 
 # include "rusini0.hh"
 
+# if RSN_USE_SECT_CHUNKS
+   # define RSN_IF_USING_SECT_CHUNKS(...) __VA_ARGS__ // private to this header
+# else
+   # define RSN_IF_USING_SECT_CHUNKS(...)
+# endif
+
 // Arithmetic: using signed integral types (with UB-on-overflow semantics) where possible; preferring 32-bit operations and zero extension where applicable
 // Integral types: preferring plain C++ type names to cstdint aliases for extra clarity on type promotion/conversion rules applied
 // Aliasing rules: adhering to P0593R6 and to C11 wording about memcpy/memmove special cases (and using the GCC extension RSN_BARRIER where required)
 // Assertion strategy: stating only trivially checkable preconditions (leaving other kinds of preconditions to be documented elsewhere, if at all)
 
 namespace rsn {
+# if RSN_USE_SECT_CHUNKS
+   // distinct ABI (layout of objcode::_sect), so that mixing translation units built with and without RSN_USE_SECT_CHUNKS fails at link time
+   inline namespace _sect_chunks {
+# endif
 
    class objcode /*object code*/ { // with relocations suitable for the target ISA
    public:
@@ -40,17 +50,30 @@ namespace rsn {
       class _sect/*ion*/ {
       public:
          unsigned char *pc = {};         // section program-counter for code/data emission
-         const unsigned char *base = {}; // start of buffer
+         const unsigned char *base = {}; // start of buffer (of the current chunk)
          int res = 0, alloc = 0;         // requested and actual buffer size, in bytes (not exceeding 1 << max_segm_size_p2)
          int align = 1;                  // alignment requirements accumulated so far, a power of two in bytes (not exceeding 1 << cacheline_size_p2)
          const bool is_rodata;           // whether the section contains text (code) or read-only data
+      # if RSN_USE_SECT_CHUNKS
+         // Buffer as a rope of chunks (of a fixed size, after geometric growth for small sections, unless more is reserved at once): the slow path of
+         // sect::reserve starts a new chunk (sized for the whole outstanding reservation) instead of relocating the buffer, and res/alloc are counted
+         // from the start of the section, so that reserved space is always contiguous (within the current chunk).
+         int off = 0;                    // offset of the current chunk from the start of the section
+         struct chunk { const unsigned char *base; int size; };
+         std::vector<chunk> chunks;      // preceding (completed) chunks
+      # endif
       public: // standard operations and construction
          RSN_INLINE _sect(_sect &&rhs) noexcept // only move-constructible and not copy-constructible of assignable
-            : pc(rhs.pc), base(rhs.base), res(rhs.res), alloc(rhs.alloc), align(rhs.align), is_rodata(rhs.is_rodata) { rhs.base = {}; }
-         RSN_INLINE ~_sect()
-            { if (RSN_UNLIKELY(base)) std::free(const_cast<unsigned char *>(base)); } // own fast/slow path split
+            : pc(rhs.pc), base(rhs.base), res(rhs.res), alloc(rhs.alloc), align(rhs.align), is_rodata(rhs.is_rodata)
+            RSN_IF_USING_SECT_CHUNKS(, off(rhs.off), chunks(std::move(rhs.chunks))) { rhs.base = {}; }
+         RSN_INLINE ~_sect() { // own fast/slow path split
+            if (RSN_UNLIKELY(base)) std::free(const_cast<unsigned char *>(base));
+            RSN_IF_USING_SECT_CHUNKS(for (auto chunk: chunks) std::free(const_cast<unsigned char *>(chunk.base));)
+         }
       public:
          RSN_INLINE explicit _sect(decltype(is_rodata) is_rodata) noexcept: is_rodata(is_rodata) {} // non-aggregate
+      public: // current size of contents, in bytes
+         RSN_INLINE int size() const noexcept { return pc - base RSN_IF_USING_SECT_CHUNKS(+ off); }
       public: // helper stuff
          struct fixup { // AKA relocation records - specific to x86 and x86-64 ISAs (suitable for x86 and all code models for x86-64)
             enum { plus_label_quad, plus_label_long, plus_label_minus_next_addr_long, plus_label_minus_next_addr_byte, minus_next_addr_long } kind;
@@ -104,6 +127,17 @@ namespace rsn {
                owner._sects[id.sn].res += size; // fast path
             else [](auto &sect, auto size)RSN_NOINLINE {
                if (RSN_UNLIKELY((unsigned)sect.res + size > 1 << max_segm_size_p2)) throw std::bad_alloc{};
+            # if RSN_USE_SECT_CHUNKS
+               int pc = sect.pc - sect.base;
+               auto res = sect.res + size, req = res - (sect.off + pc); // req - contiguous space required from the current program-counter onwards
+               auto alloc = std::min(std::max(req + req / 2, std::min(sect.off + pc, 1 << chunk_size_p2)), (1 << max_segm_size_p2) - (sect.off + pc));
+               if (RSN_LIKELY(pc)) sect.chunks.push_back({sect.base, pc});
+               auto base = static_cast<unsigned char *>(std::malloc((unsigned)alloc));
+               if (RSN_UNLIKELY(!base)) { if (RSN_LIKELY(pc)) sect.chunks.pop_back(); throw std::bad_alloc{}; }
+               if (RSN_UNLIKELY(!pc)) std::free(const_cast<unsigned char *>(sect.base)); // nothing emitted into the current chunk yet
+               sect.off += pc, sect.base = sect.pc = base, sect.alloc = sect.off + alloc;
+               sect.res = res;
+            # else
                int pc = sect.pc - sect.base;
                auto res = sect.res + size;
                auto base = static_cast<unsigned char *>(std::realloc(const_cast<unsigned char *>(sect.base),
@@ -111,6 +145,7 @@ namespace rsn {
                if (RSN_UNLIKELY(!base)) throw std::bad_alloc{};
                sect.base = base, sect.pc = base + pc, sect.alloc = std::min(res + res / 2, 1 << max_segm_size_p2);
                sect.res = res;
+            # endif
             }(owner._sects[id.sn], size); // slow path
             return *this;
          }
@@ -143,23 +178,23 @@ namespace rsn {
          // symbolic and relative addresses
          RSN_INLINE auto q (struct label label, decltype(x86quad::_) offset = 0) const { // for 64-bit code models
             return owner._fixups.push_back({_sect::fixup::plus_label_quad, id.sn,
-               (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base), label.id.sn}), q(offset);
+               owner._sects[id.sn].size(), label.id.sn}), q(offset);
          }
          RSN_INLINE auto l (struct label label, decltype(x86long::_) offset = 0) const { // for 32-bit code models
             return owner._fixups.push_back({_sect::fixup::plus_label_long, id.sn,
-               (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base), label.id.sn}), l(offset);
+               owner._sects[id.sn].size(), label.id.sn}), l(offset);
          }
          RSN_INLINE auto rl(struct label label, decltype(x86long::_) offset = 0) const {
             return owner._fixups.push_back({_sect::fixup::plus_label_minus_next_addr_long, id.sn,
-               (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base), label.id.sn}), l(offset);
+               owner._sects[id.sn].size(), label.id.sn}), l(offset);
          }
          RSN_INLINE auto rb(struct label label, decltype(x86byte::_) offset = 0) const {
             return owner._fixups.push_back({_sect::fixup::plus_label_minus_next_addr_byte, id.sn,
-               (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base), label.id.sn}), b(offset);
+               owner._sects[id.sn].size(), label.id.sn}), b(offset);
          }
          RSN_INLINE auto rl(decltype(x86long::_) val) const { // for 32-bit code models
             return owner._fixups.push_back({_sect::fixup::minus_next_addr_long, id.sn,
-               (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base)}), l(val);
+               owner._sects[id.sn].size()}), l(val);
          }
          // convenience helpers for the above
          template<typename Type> RSN_INLINE auto rl(Type *val) const { return rl(reinterpret_cast<unsigned long>(val)); } // for 32-bit code models
@@ -169,7 +204,7 @@ namespace rsn {
             assert(max >= 0 && (max < boundary || max == 1 << cacheline_size_p2));
             assert(size() + std::min(boundary - 1, max) <= reserved());
 
-            int pad_size = owner._sects[id.sn].base - owner._sects[id.sn].pc & boundary - 1;
+            int pad_size = -owner._sects[id.sn].size() & boundary - 1;
             if (RSN_LIKELY(pad_size > max)) return *this;
             if (RSN_UNLIKELY(owner._sects[id.sn].align < boundary)) owner._sects[id.sn].align = boundary;
             if (RSN_UNLIKELY(pad_size)) [](auto sect, auto pad_size)RSN_NOINLINE {
@@ -193,11 +228,11 @@ namespace rsn {
          }
       public: // defining (placing) labels
          RSN_INLINE auto label(struct label label, int offset = 0) const noexcept
-            { assert(&label.owner == &owner); owner._labels[label.id.sn] = {id.sn, (int)(owner._sects[id.sn].pc - owner._sects[id.sn].base) + offset}; return *this; }
+            { assert(&label.owner == &owner); owner._labels[label.id.sn] = {id.sn, owner._sects[id.sn].size() + offset}; return *this; }
          // convenience helpers for the above
          RSN_INLINE auto label(int offset = 0) const { auto label = owner.label(); this->label(label, offset); return label; }
       public: // misc operations
-         RSN_INLINE int size() const noexcept { return owner._sects[id.sn].pc - owner._sects[id.sn].base; }
+         RSN_INLINE int size() const noexcept { return owner._sects[id.sn].size(); }
          RSN_INLINE int reserved() const noexcept { return owner._sects[id.sn].res; }
       };
       // Target Memory Segment for Object Code Loading /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -234,6 +269,15 @@ namespace rsn {
          if (RSN_UNLIKELY((decltype(label::id::sn))_labels.size() == std::numeric_limits<decltype(label::id::sn)>::max())) throw std::bad_alloc{};
          _labels.emplace_back(); return {*this, decltype(label::id){(decltype(label::id::sn))_labels.size() - 1}};
       }
+   # if __x86_64__ && __SIZEOF_POINTER__ == __SIZEOF_LONG_LONG__
+   public: // lazily compiled call targets (specific to the x86-64 ISA and System V ABI)
+      // The resulting label designates an indirection slot to call through (as in "call *label(%rip)", that is .sw(0xFF15).rl(label)); the slot
+      // initially refers to a small stub, which on first invocation calls compile(data) to obtain the target code address, installs the latter into
+      // the slot, and tail-jumps to it, so that later calls go (almost) direct. All argument registers (including the full vector state, by means of
+      // XSAVE or, where unavailable, FXSAVE) are preserved around compile. compile is invoked from the JIT-compiled code, must not throw, and must
+      // return the same non-null address if invoked more than once (which may happen under concurrent first invocations).
+      struct label lazy(void *(*compile)(void *data), void *data = {}) &;
+   # endif
    public: // misc operations
       RSN_INLINE struct sect sect(bool is_rodata) & {
          if (RSN_UNLIKELY((decltype(sect::id::sn))_sects.size() == std::numeric_limits<decltype(sect::id::sn)>::max())) throw std::bad_alloc{};
@@ -243,16 +287,21 @@ namespace rsn {
       int size() const noexcept;
       void load(unsigned char *) const;
    public:
-      RSN_INLINE void clear() noexcept { _sects.clear(), _fixups.clear(), _labels.clear(); }
+      RSN_INLINE void clear() noexcept { _sects.clear(), _fixups.clear(), _labels.clear(), _lazy_sect = -1; }
    private: // internal representation
       std::vector<_sect>        _sects;
       std::vector<_sect::fixup> _fixups;
       std::vector<_label>       _labels;
+      int _lazy_sect/*s/n*/ = -1; // section for lazy stubs, if already created
    private: // internal helper constants
       static constexpr auto
          cacheline_size_p2 =  6 /*64 B*/,   // for CPU L#i/L#d caches (typically 64 B for x86/x86-64 CPUs and many others)
          page_size_p2      = 12 /* 4 KiB*/; // for MMU paging (typically 4 KiB for x86/x86-64 CPUs and many others)
       static_assert(cacheline_size_p2 < page_size_p2);
+   # if RSN_USE_SECT_CHUNKS
+      static constexpr auto chunk_size_p2 = 16 /*64 KiB*/; // for section buffers (chunks grow geometrically up to this size, unless more is reserved at once)
+      static_assert(chunk_size_p2 >= page_size_p2);
+   # endif
    private:
       static constexpr auto
          max_segm_size_p2 = // maximum size of an executable segment
@@ -276,9 +325,14 @@ namespace rsn {
 
    RSN_INLINE inline void swap(objcode::segm &lhs, objcode::segm &rhs) noexcept { lhs.swap(rhs); }
 
+# if RSN_USE_SECT_CHUNKS
+   } // inline namespace _sect_chunks
+# endif
 } // namespace rsn
 
 constexpr decltype(rsn::objcode::sect::id)  rsn::objcode::sect::id::unspec{int{}};
 constexpr decltype(rsn::objcode::label::id) rsn::objcode::label::id::unspec{int{}};
 
+# undef RSN_IF_USING_SECT_CHUNKS
+
 # endif // # ifndef RSN_INCLUDED_JIT_ASM
@@ -58,5 +58,24 @@ int main() {
    }
 
    std::printf("Found %d solutions\n", static_cast<int (*)(int)>(oc.load())(78));
+
+   // lazily compiled call target
+   {  rsn::objcode oc;
+      static int compiled;
+      auto slot = oc.lazy([](void *data)->void * {
+         ++*static_cast<int *>(data);
+         static rsn::objcode oc;
+         oc.text() .reserve(4) .sw(0x8D47).b(1) .b(0xC3); // leal 1(%rdi), %eax; ret
+         static auto segm = oc.load(); return static_cast<void *>(segm);
+      }, &compiled);
+      oc.text() .reserve(32)
+         .sl(0x4883EC'08)                 // subq $8, %rsp
+         .sw(0xFF15).rl(slot)             // call *slot(%rip)
+         .sw(0x89C7) .sw(0xFF15).rl(slot) // movl %eax, %edi; call *slot(%rip)
+         .sl(0x4883C4'08) .b(0xC3);       // addq $8, %rsp; ret
+      auto segm = oc.load();
+      auto res = static_cast<int (*)(int)>(segm)(40);
+      std::printf("Lazy result %d (compiled %d time(s))\n", res, compiled);
+   }
    return 0;
 }